@@ -19,14 +19,19 @@ Program goals:
 X   Provide a prompt for running commands
 X   Handle blank lines and comments, which are lines beginning with the # character
 X   Provide expansion for the variable $$
+X   Expand $?, $NAME and ${NAME}, with export and unset builtins
+X   'map [-P N] [-n K] cmd -- args' runs cmd over batches of args in parallel
 X   Execute 3 commands exit, cd, and status via code built into the shell
 X   Execute other commands by creating new processes using a function from the exec family of functions
 X   Support input and output redirection
+X   Support here-strings ('<<< word') and heredocs ('<<TAG')
 X   Support running commands in foreground and background processes
 X   Implement custom handlers for 2 signals, SIGINT and SIGTSTP
+X   Optional fixed memory budget ('--mem-budget 256K'), reported by 'meminfo'
 */
 
 /* Includes */
+#define _GNU_SOURCE             // memfd_create
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -35,36 +40,37 @@ X   Implement custom handlers for 2 signals, SIGINT and SIGTSTP
 #include <string.h>
 #include <signal.h>
 #include <fcntl.h>
-
-/* Definitions */
-#define MAX_CHARS 2048
-#define MAX_ARGS 512
-
-
-/* Struct(s) */
-typedef struct Command {
-    char * command[MAX_ARGS + 1];
-    short int skip;
-    short int builtin;
-    short int background;
-    int argCount;
-} Command;
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include "smallsh.h"      // Definitions, structs and shared prototypes
 
 /* Function Prototypes*/
 void handleSIGINT(int signal);
 void handleSIGTSTP(int signal);
 void configSIGS();
-Command * parseCommand();
-char* replaceToken(char *, char *);
-void execCommand(Command *);
+pid_t launchCommand(Command *, const sigset_t *);
+void outChildStatus(OutBuf *, pid_t, int);
+void holdChildSignals();
 void inputRedirect(Command *);
 void outputRedirect(Command *);
 void execExit();
 void execCd(Command *);
 void execStatus(Command *);
 void execOther(Command *);
-void freeCommand(Command *);
-char * checkExpansion(char *, char *);
+void varInit();
+unsigned int varHash(const char *, size_t);
+Var * varFind(const char *, size_t);
+void execExport(Command *);
+void execUnset(Command *);
+void execMap(Command *);
+void mapReap(MapJobs *, int);
+int mapLaunch(Command *, int, int, MapJobs *, int);
+int mapWaitList(FILE *, MapJobs *);
+void outSeconds(OutBuf *, struct timespec, struct timespec);
 
 void test_replaceToken();
 
@@ -72,6 +78,21 @@ void test_replaceToken();
 int lastForegroundStatus = 0;
 int foregroundOnlyMode = 0;
 int foregroundProcessRunning = 0;
+volatile sig_atomic_t sigintReceived = 0;  // Set by handleSIGINT, stops map launching batches
+short int childSignalsHeld = 0; // SIGCHLD is blocked, see holdChildSignals
+volatile sig_atomic_t backgroundJobs = 0;  // Background children not yet reaped
+sigset_t shellMask;             // Signal mask from before SIGCHLD was held, given to children
+OutBuf shellOut = {0};          // Main-loop output, never touched by signal handlers
+size_t memBudget = 0;           // Size of memRegion, 0 means plain malloc
+char * memRegion = NULL;        // All shell allocations when a budget is set
+MemStats memStats[MEM_SUBSYSTEMS] = {{0}};
+MemStats memTotal = {0};
+const char * memNames[MEM_SUBSYSTEMS] = { "parser", "heredoc", "vars", "map" };
+Var * varTable[VAR_BUCKETS] = {0};  // Shell variables, hashed by name
+char ** varEnv = NULL;          // Cached envp of exported variables
+short int varEnvDirty = 1;      // An exported variable changed since varEnv was built
+int varExportedCount = 0;
+extern char ** environ;
 
 
 
@@ -81,6 +102,7 @@ int foregroundProcessRunning = 0;
 // #define DEBUG_TOKEN
 
 
+#ifndef SMALLSH_TEST     // test.c provides its own main
 /* ----------------------------------------
     Function: main
 ===========================================
@@ -88,14 +110,33 @@ int foregroundProcessRunning = 0;
 Desc: main function, handles program starting.
 Creates infinite loop that keeps shell alive.
 
-Params: N/A
+Params:
+argc: int, argument count
+argv: char **, '--mem-budget SIZE' caps all shell
+memory to one region of SIZE bytes (K/M suffix ok)
 ---------------------------------------- */
-int main(){
+int main(int argc, char ** argv){
     // Debugging - Note: prefix 'DEBUG' meant for debugging, no functionality
     #ifdef DEBUG_TOKEN
     test_replaceToken();
     #endif
 
+    // Check for a memory budget
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--mem-budget") == 0 && i + 1 < argc) {
+            if(memInit(parseSize(argv[++i])) == -1) {
+                fprintf(stderr, "smallsh: invalid memory budget '%s' (minimum %dK)\n", argv[i], MEM_MIN_BUDGET / 1024);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--mem-budget SIZE]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Load the inherited environment into the variable table
+    varInit();
+
     // Configure the signals
     configSIGS();
 
@@ -103,6 +144,10 @@ int main(){
     while(1){
         // Parse command 
         Command * command = parseCommand();
+        // Nothing parsed, the memory budget is exhausted
+        if(command == NULL){
+            continue;
+        }
         // Determine if we skip 
         if(command->skip){
             freeCommand(command);
@@ -115,6 +160,7 @@ int main(){
     }
     return 0;
 }
+#endif /* SMALLSH_TEST */
 
 /* ----------------------------------------
     Function: handleSIGCHLD
@@ -129,22 +175,53 @@ signal: int, signal to handle
 void handleSIGCHLD(int signal) {
     pid_t childPid;
     int childStatus;
+    int savedErrno = errno;
+    // Local buffer, every reaped child goes out in a single write
+    OutBuf out;
+    out.len = 0;
 
     // While valid
     while ((childPid = waitpid(-1, &childStatus, WNOHANG)) > 0) {
+        backgroundJobs--;
         // As long as there is a foreground process
         if (!foregroundProcessRunning) {
             // Check child status, print approrpiate info.
-            if (WIFEXITED(childStatus)) {
-                printf("\nBackground PID %d is done: exit value %d\n", childPid, WEXITSTATUS(childStatus));
-            } else if (WIFSIGNALED(childStatus)) {
-                printf("\nBackground PID %d is done: terminated by signal %d\n", childPid, WTERMSIG(childStatus));
-            }
+            outChildStatus(&out, childPid, childStatus);
             // User prompt
-            printf(": ");
-            fflush(stdout);
+            outStr(&out, ": ");
         }
     }
+    outWrite(&out);
+    errno = savedErrno;
+}
+
+/* ----------------------------------------
+    Function: outChildStatus
+===========================================
+Desc: Formats the "Background PID ... is done"
+line for a reaped child. Async-signal-safe, used
+by handleSIGCHLD and by map when it reaps a
+background job.
+
+Params:
+out: OutBuf * , buffer to append to
+childPid: pid_t , reaped child
+childStatus: int , status from waitpid
+---------------------------------------- */
+void outChildStatus(OutBuf * out, pid_t childPid, int childStatus) {
+    if (WIFEXITED(childStatus)) {
+        outStr(out, "\nBackground PID ");
+        outInt(out, childPid);
+        outStr(out, " is done: exit value ");
+        outInt(out, WEXITSTATUS(childStatus));
+        outStr(out, "\n");
+    } else if (WIFSIGNALED(childStatus)) {
+        outStr(out, "\nBackground PID ");
+        outInt(out, childPid);
+        outStr(out, " is done: terminated by signal ");
+        outInt(out, WTERMSIG(childStatus));
+        outStr(out, "\n");
+    }
 }
 
 /* ----------------------------------------
@@ -171,16 +248,20 @@ signal: int, signal to handle
 ---------------------------------------- */
 void handleSIGINT(int signal){
     if (signal == SIGINT) {
+        int savedErrno = errno;
+        OutBuf out;
+        out.len = 0;
+        sigintReceived = 1;
 
         if (foregroundProcessRunning) {
             // A foreground process is running, the child process should handle its own termination
-            printf("\n");
-            fflush(stdout);
+            outStr(&out, "\n");
         } else {
             // No foreground process is running, print a new prompt
-            printf("\n: ");
-            fflush(stdout);
+            outStr(&out, "\n: ");
         }
+        outWrite(&out);
+        errno = savedErrno;
     }
 }
 
@@ -243,26 +324,29 @@ Params:
 signal: int, signal to be handled
 ---------------------------------------- */
 void handleSIGTSTP(int signal) {
+    int savedErrno = errno;
+    OutBuf out;
+    out.len = 0;
+
     // Make sure valid signal
     if (signal == SIGTSTP) {
         // Print appropriate message
         if (foregroundOnlyMode == 0) {
             // Enter foreground-only mode
             foregroundOnlyMode = 1;
-            printf("\nEntering foreground-only mode (& is now ignored)\n");
-            fflush(stdout);
+            outStr(&out, "\nEntering foreground-only mode (& is now ignored)\n");
         } else {
             // Exit foreground-only mode
             foregroundOnlyMode = 0;
-            printf("\nExiting foreground-only mode\n");
-            fflush(stdout);
+            outStr(&out, "\nExiting foreground-only mode\n");
         }
     }
     // Check if user prompt needs to be made again
     if (!foregroundProcessRunning) {
-        printf(": ");
-        fflush(stdout);
+        outStr(&out, ": ");
     }
+    outWrite(&out);
+    errno = savedErrno;
 }
 
 
@@ -277,32 +361,38 @@ the command is meant to be ran in the background. It also
 checks if the command (first argument) is built in. 
 
 Params: N/A
+Returns: the command, NULL if over the memory budget
 ---------------------------------------- */
 Command * parseCommand(){
-    // Struct that represents a command 
-    Command * command = (Command *)malloc(sizeof(Command));
-    if(command == NULL) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        exit(EXIT_FAILURE);
+    outStr(&shellOut, ": ");                // Prompt user interaction
+    // One write per loop iteration: the last command's status lines plus this prompt
+    outWrite(&shellOut);
+    // SIGCHLD was held since the last launch so its reports can't overtake that write.
+    // With no background job left there is nothing to report, so keep holding it
+    // and save the block/unblock pair around every foreground command.
+    if(childSignalsHeld && backgroundJobs > 0) {
+        sigset_t childMask;
+        sigemptyset(&childMask);
+        sigaddset(&childMask, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &childMask, NULL);
+        childSignalsHeld = 0;
     }
-    // Default values for the command
-    command->argCount = 0;                  // Initially no command arguments
-    command->skip = 0;
-    command->builtin = 0;
-    command->background = 0;
-
-    printf(": ");                           // Prompt user interaction, make sure it's output
-    fflush(stdout);
     
     // Represents command given to shell in string form (max size)
     char commandStr[MAX_CHARS];
     // Gets command as string
     if(fgets(commandStr, MAX_CHARS, stdin) == NULL) {
-        freeCommand(command);
         exit(EXIT_FAILURE); // Exit on read failure
     }
     commandStr[strcspn(commandStr, "\n")] = '\0'; // Remove newline
 
+    // Struct that represents a command, the line is dropped if the budget can't hold it
+    Command * command = newCommand(MEM_PARSER);
+    if(command == NULL) {
+        fprintf(stderr, "Memory budget exceeded, command skipped.\n");
+        return NULL;
+    }
+
     char * token = strtok(commandStr , " ");    // Gets token (argument) based on a space (' ') as the delimiter
 
     // Check if line is skippable, mark and return if so
@@ -319,38 +409,75 @@ Command * parseCommand(){
             exit(EXIT_FAILURE);
         }
 
-        // Allocate memory for command arg
-        command->command[command->argCount] = (char *)malloc(MAX_CHARS);
-        if(command->command[command->argCount] == NULL) {
-            fprintf(stderr, "Memory allocation failed.\n");
-            freeCommand(command);
-            exit(EXIT_FAILURE);
+        // Here-string: '<<< word' or '<<<word', the word (plus newline) becomes stdin
+        if(strncmp(token, "<<<", 3) == 0) {
+            char * word = (token[3] != '\0') ? token + 3 : strtok(NULL, " ");
+            if(word == NULL) {
+                fprintf(stderr, "Syntax error: missing word after '<<<'\n");
+                command->skip = 1;
+                return command;
+            }
+            char expandedWord[MAX_CHARS];
+            expandToken(word, expandedWord, MAX_CHARS);
+            if(setHereString(command, expandedWord) == -1) {
+                command->skip = 1;
+                return command;
+            }
+            token = strtok(NULL, " ");
+            continue;
+        }
+
+        // Heredoc: '<<TAG' or '<< TAG', following lines up to TAG become stdin
+        if(strncmp(token, "<<", 2) == 0) {
+            char * tag = (token[2] != '\0') ? token + 2 : strtok(NULL, " ");
+            if(tag == NULL) {
+                fprintf(stderr, "Syntax error: missing delimiter after '<<'\n");
+                command->skip = 1;
+                return command;
+            }
+            if(readHereDoc(command, tag) == -1) {
+                command->skip = 1;
+                return command;
+            }
+            token = strtok(NULL, " ");
+            continue;
         }
 
-        // Check if token has variable that needs to be replaced
-        char * position = strstr(token, "$$");
-        if(position != NULL){
-            replaceToken(token, position);
+        // Expand $$, $?, $NAME and ${NAME}
+        char expanded[MAX_CHARS];
+        size_t tokenLen = expandToken(token, expanded, MAX_CHARS);
+        // Like other shells, a word that expands to nothing is dropped
+        if(tokenLen == 0) {
+            token = strtok(NULL, " ");
+            continue;
         }
 
         // Copies token to command argument array
-        strncpy(command->command[command->argCount], token, MAX_ARGS - 1);
+        if(addArg(command, expanded, tokenLen, MEM_PARSER) == -1) {
+            fprintf(stderr, "Memory budget exceeded, command skipped.\n");
+            command->skip = 1;
+            return command;
+        }
 
-        //command->command[command->argCount][MAX_CHARS - 1] = '\0'; // Ensure null-termination
-        command->argCount++;                    // Increment arg count
         token = strtok(NULL, " ");              // Update token to point to next
     }
 
     // Null-terminate the command array
     command->command[command->argCount] = NULL;
 
+    // A line holding only a here-string/heredoc or empty expansions has nothing to run
+    if (command->argCount == 0) {
+        command->skip = 1;
+        return command;
+    }
+
     // Check if background command - look for '&' symbol
     if (command->argCount > 0 && strcmp(command->command[command->argCount - 1], "&") == 0){
         // If in foregroundOnlyMode, skip marking it, but do everything else.
         if(foregroundOnlyMode != 1){
             command->background = 1;                            // Mark as background
         }
-        free(command->command[command->argCount - 1]);      // Deallocate that part of the command 
+        memFree(command->command[command->argCount - 1]);   // Deallocate that part of the command 
         command->command[command->argCount - 1] = NULL;     // Make old command new pointer to NULL
         command->argCount--;                                // Decrease argCount
     }
@@ -363,11 +490,75 @@ Command * parseCommand(){
         command->builtin = 2;
     } else if(strcmp(strtok(command->command[0], "\n"), "status") == 0) {
         command->builtin = 3;
+    } else if(strcmp(strtok(command->command[0], "\n"), "meminfo") == 0) {
+        command->builtin = 4;
+    } else if(strcmp(strtok(command->command[0], "\n"), "export") == 0) {
+        command->builtin = 5;
+    } else if(strcmp(strtok(command->command[0], "\n"), "unset") == 0) {
+        command->builtin = 6;
+    } else if(strcmp(strtok(command->command[0], "\n"), "map") == 0) {
+        command->builtin = 7;
+    }
+    return command;
+}
+
+
+/* ----------------------------------------
+    Function: newCommand
+===========================================
+Desc: Allocates an empty command.
+
+Params:
+subsystem: int , MemSubsystem to charge
+Returns: the command, NULL if over the memory budget
+---------------------------------------- */
+Command * newCommand(int subsystem){
+    Command * command = (Command *)memAlloc(sizeof(Command), subsystem);
+    if(command == NULL) {
+        return NULL;
     }
+    // Default values for the command
+    command->command[0] = NULL;
+    command->argCount = 0;                  // Initially no command arguments
+    command->skip = 0;
+    command->builtin = 0;
+    command->background = 0;
+    command->hereDoc = NULL;
+    command->hereDocLen = 0;
+    command->literalArgs = 0;
     return command;
 }
 
 
+/* ----------------------------------------
+    Function: addArg
+===========================================
+Desc: Appends a copy of arg to the command's
+argument array, keeping it NULL-terminated.
+
+Params:
+command: Command * , command to extend
+arg: const char * , argument to copy
+len: size_t , length of arg
+subsystem: int , MemSubsystem to charge
+Returns: 0 on success, -1 if over the memory budget
+---------------------------------------- */
+int addArg(Command * command, const char * arg, size_t len, int subsystem){
+    // Allocate memory for command arg, only as much as it needs
+    char * copy = (char *)memAlloc(len + 1, subsystem);
+    if(copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, arg, len);
+    copy[len] = '\0';
+
+    command->command[command->argCount] = copy;
+    command->argCount++;                    // Increment arg count
+    command->command[command->argCount] = NULL;
+    return 0;
+}
+
+
 /* ----------------------------------------
     Function: execCommand
 ===========================================
@@ -381,13 +572,108 @@ command: Command * , command to process
 ---------------------------------------- */
 void execCommand(Command * command){    
 
+    // export and unset change the shell's own variables, meminfo reports the
+    // shell's own memory, so no fork
+    if(command->builtin == 4) {
+        execMeminfo();
+        return;
+    } else if(command->builtin == 5) {
+        execExport(command);
+        return;
+    } else if(command->builtin == 6) {
+        execUnset(command);
+        return;
+    } else if(command->builtin == 7) {
+        execMap(command);
+        return;
+    }
+
+    // Keep handleSIGCHLD from reaping (and reporting) a foreground child before waitpid
+    // does, or a background one before its "Background PID" line is out.
+    // parseCommand unblocks it after the next prompt is written.
+    holdChildSignals();
+
     // To execute command, fork, parent runs shell
+    pid_t spawnpid = launchCommand(command, &shellMask);
+
+    // Parent checks if meant to be background
+    if (!command->background) {
+        foregroundProcessRunning = 1;
+        // If not meant to be in background then update the last foreground status
+        int childStatus;
+        // Wait and get child status, shell does not return to user control until done.
+        waitpid(spawnpid, &childStatus, 0);
+        lastForegroundStatus = childStatus; // Update the lastForegroundStatus variable
+        // If the child is signaled to stop, print info
+        if (WIFSIGNALED(childStatus)) {
+            int termSignal = WTERMSIG(childStatus);
+            outStr(&shellOut, "\nTerminated by signal ");
+            outInt(&shellOut, termSignal);
+            outStr(&shellOut, "\n");
+        }
+        foregroundProcessRunning = 0;
+    } else {
+        backgroundJobs++;
+        // Otherwise print the background pid
+        outStr(&shellOut, "Background PID: ");
+        outInt(&shellOut, spawnpid);
+        outStr(&shellOut, "\n");
+    }
+    // Status lines go out with the next prompt
+}
+
+
+/* ----------------------------------------
+    Function: holdChildSignals
+===========================================
+Desc: Blocks SIGCHLD, unless it already is, and
+saves the mask it replaced in shellMask for
+children to start with. parseCommand releases
+it once a background job is running.
+
+Params: N/A
+---------------------------------------- */
+void holdChildSignals(){
+    if(childSignalsHeld) {
+        return;
+    }
+    sigset_t childMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &shellMask);
+    childSignalsHeld = 1;
+}
+
+
+/* ----------------------------------------
+    Function: launchCommand
+===========================================
+Desc: Forks a child that sets up redirection
+and runs the command (built in or exec'd).
+Returns in the parent only.
+
+Params:
+command: Command * , command to run
+childMask: const sigset_t * , signal mask for the
+child, NULL to keep the current one
+Returns: child's pid
+---------------------------------------- */
+pid_t launchCommand(Command * command, const sigset_t * childMask){
+    // Pending shell output must precede the child's, and not be inherited by it
+    outWrite(&shellOut);
+
+    // Rebuild envp here if needed, so the cached copy survives for later launches
+    varEnvp();
+
     pid_t spawnpid = fork();
     if (spawnpid == -1) {
         perror("fork() failed!");
         exit(1);
     } else if (spawnpid == 0) {
-        // Child executes command 
+        // Child executes command with the shell's original signal mask
+        if (childMask != NULL) {
+            sigprocmask(SIG_SETMASK, childMask, NULL);
+        }
         inputRedirect(command);
         outputRedirect(command);
 
@@ -405,34 +691,15 @@ void execCommand(Command * command){
                         execStatus(command);
                         break;
             }
+            // Built in is done, child must not go on as a second shell. _exit, as the
+            // child shares stdin's offset and exit() would rewind it to flush stdio
+            _exit(EXIT_SUCCESS);
         } else {
             // If it's not built in, pass to function to use exec family 
             execOther(command);
         }
-    } else {
-        // Parent checks if meant to be background
-        if (!command->background) {
-            foregroundProcessRunning = 1;
-            // If not meant to be in background then update the last foreground status
-            int childStatus;
-            // Wait and get child status, shell does not return to user control until done.
-            waitpid(spawnpid, &childStatus, 0);
-            lastForegroundStatus = childStatus; // Update the lastForegroundStatus variable
-            // If the child is signaled to stop, print info
-            if (WIFSIGNALED(childStatus)) {
-                int termSignal = WTERMSIG(childStatus);
-                printf("\nTerminated by signal %d\n", termSignal);
-                fflush(stdout);
-            }
-            foregroundProcessRunning = 0;
-        } else {
-            // Otherwise print the background pid
-            printf("Background PID: %d\n", spawnpid);
-            fflush(stdout);
-        }
     }
-
-    
+    return spawnpid;
 }
 
 
@@ -446,6 +713,20 @@ Params: command: Command *, command to search
 ---------------------------------------- */
 void inputRedirect(Command * command){
     int inputFile = -1;
+    // Here-string / heredoc body is fed as stdin, a later '<' overrides it
+    if(command->hereDoc != NULL) {
+        inputFile = hereDocFd(command->hereDoc, command->hereDocLen);
+        if(inputFile == -1) {
+            perror("failed to create heredoc input");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(inputFile, STDIN_FILENO);
+        close(inputFile);
+    }
+    // Nothing in a literal argv is a redirection
+    if(command->literalArgs) {
+        return;
+    }
     // Goes through all commands
     for(int i = 0; command->command[i] != NULL; i++){
         // Looks for '<'
@@ -456,8 +737,7 @@ void inputRedirect(Command * command){
                 // If open fails, print warning and exit
                 if(inputFile == -1) {
                     perror("failed to open input file");
-                    return;
-                    exit(EXIT_FAILURE);
+                    _exit(EXIT_FAILURE);
                 }
                 // Actual redirection using our new file
                 dup2(inputFile, STDIN_FILENO);
@@ -469,12 +749,157 @@ void inputRedirect(Command * command){
             // If input file name is null, print error
             } else{
                 fprintf(stderr, "Syntax error: missing input file name after '<'\n");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
         }
     }
 }
 
+/* ----------------------------------------
+    Function: setHereString
+///////////////////////////////////////////
+Desc: Stores the word given to '<<<' as the
+command's stdin body, with a trailing newline
+like bash.
+
+Params:
+command: Command *, command to attach body to
+word: const char *, here-string word
+---------------------------------------- */
+int setHereString(Command * command, const char * word){
+    size_t len = strlen(word);
+    char * body = (char *)memAlloc(len + 2, MEM_HEREDOC);
+    if(body == NULL) {
+        fprintf(stderr, "Memory budget exceeded, here-string dropped.\n");
+        return -1;
+    }
+    memcpy(body, word, len);
+    body[len] = '\n';
+    body[len + 1] = '\0';
+
+    memFree(command->hereDoc);
+    command->hereDoc = body;
+    command->hereDocLen = len + 1;
+    return 0;
+}
+
+/* ----------------------------------------
+    Function: readHereDoc
+///////////////////////////////////////////
+Desc: Reads lines from stdin until a line equal
+to tag, storing them (with $ expansion, like an
+unquoted bash heredoc) as the command's stdin body.
+Hitting EOF first warns and keeps what was read.
+If the body outgrows the memory budget the rest is
+still consumed (so it isn't run as commands) and
+-1 is returned.
+
+Params:
+command: Command *, command to attach body to
+tag: const char *, delimiter line
+---------------------------------------- */
+int readHereDoc(Command * command, const char * tag){
+    size_t cap = MAX_CHARS;
+    size_t len = 0;
+    size_t tagLen = strlen(tag);
+    char * body = (char *)memAlloc(cap, MEM_HEREDOC);
+    char line[MAX_CHARS];
+
+    while(1) {
+        if(fgets(line, MAX_CHARS, stdin) == NULL) {
+            fprintf(stderr, "warning: heredoc delimited by end-of-file (wanted '%s')\n", tag);
+            break;
+        }
+        size_t lineLen = strlen(line);
+        // Compare without the newline
+        if(strncmp(line, tag, tagLen) == 0 && (line[tagLen] == '\n' || line[tagLen] == '\0')) {
+            break;
+        }
+        // Already over budget, just skip to the tag
+        if(body == NULL) {
+            continue;
+        }
+        // Body lines are expanded like words, the tag line is not
+        char expanded[MAX_CHARS];
+        lineLen = expandToken(line, expanded, MAX_CHARS);
+        // Grow body as needed
+        if(len + lineLen + 1 > cap) {
+            while(len + lineLen + 1 > cap) {
+                cap *= 2;
+            }
+            char * grown = (char *)memRealloc(body, cap, MEM_HEREDOC);
+            if(grown == NULL) {
+                memFree(body);
+                body = NULL;
+                continue;
+            }
+            body = grown;
+        }
+        memcpy(body + len, expanded, lineLen);
+        len += lineLen;
+    }
+    if(body == NULL) {
+        fprintf(stderr, "Memory budget exceeded, heredoc dropped.\n");
+        return -1;
+    }
+    body[len] = '\0';
+
+    memFree(command->hereDoc);
+    command->hereDoc = body;
+    command->hereDocLen = len;
+    return 0;
+}
+
+/* ----------------------------------------
+    Function: hereDocFd
+///////////////////////////////////////////
+Desc: Returns a read fd positioned at the start
+of body, without touching the file system. Bodies
+up to PIPE_BUF go through a pipe (the write can't
+block), larger ones through a sealed memfd.
+
+Params:
+body: const char *, data to read back
+len: size_t, length of body
+---------------------------------------- */
+int hereDocFd(const char * body, size_t len){
+    if(len <= PIPE_BUF) {
+        int pipeFds[2];
+        if(pipe(pipeFds) == -1) {
+            return -1;
+        }
+        if(len > 0 && write(pipeFds[1], body, len) != (ssize_t)len) {
+            close(pipeFds[0]);
+            close(pipeFds[1]);
+            return -1;
+        }
+        close(pipeFds[1]);
+        return pipeFds[0];
+    }
+
+    int memFd = memfd_create("smallsh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(memFd == -1) {
+        return -1;
+    }
+    // Write the whole body, write() may be partial
+    size_t written = 0;
+    while(written < len) {
+        ssize_t n = write(memFd, body + written, len - written);
+        if(n == -1) {
+            close(memFd);
+            return -1;
+        }
+        written += n;
+    }
+    // Seal so the reader sees a fixed, read-only body
+    if(fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1
+       || lseek(memFd, 0, SEEK_SET) == -1) {
+        close(memFd);
+        return -1;
+    }
+    return memFd;
+}
+
 /* ----------------------------------------
     Function: outputRedirect
 ///////////////////////////////////////////
@@ -485,6 +910,10 @@ Params: command: Command *, command to search
 ---------------------------------------- */
 void outputRedirect(Command * command){
     int outputFile = -1;
+    // Nothing in a literal argv is a redirection
+    if(command->literalArgs) {
+        return;
+    }
     // Goes through all commands
     for (int i = 0; command->command[i] != NULL; i++) {
         // Looks for '>'
@@ -495,7 +924,7 @@ void outputRedirect(Command * command){
                 // If open fails, print warning and exit
                 if (outputFile == -1) {
                     perror("failed to open output file");
-                    exit(EXIT_FAILURE);
+                    _exit(EXIT_FAILURE);
                 }
                 // Actual redirection using our new file
                 dup2(outputFile, STDOUT_FILENO);
@@ -507,7 +936,7 @@ void outputRedirect(Command * command){
             // If input file name is null, print error
             } else {
                 fprintf(stderr, "Syntax error: missing output file name after '>'\n");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
         }
     }
@@ -544,7 +973,7 @@ void execCd(Command * command){
 
     // Check if cd has no other arguments, in which case cd HOME
     if(command->argCount < 2){ 
-        chdir(getenv("HOME"));
+        chdir(varLookup("HOME", 4));
         #ifdef DEBUG
         system("ls");
         #endif
@@ -576,39 +1005,1143 @@ void execStatus(Command * command){
     // Check last foreground process exit status
     if (WIFEXITED(lastForegroundStatus)) {
         // If exited normally, print exist status
-        printf("Exit status: %d\n", WEXITSTATUS(lastForegroundStatus));
+        outStr(&shellOut, "Exit status: ");
+        outInt(&shellOut, WEXITSTATUS(lastForegroundStatus));
+        outStr(&shellOut, "\n");
     // Check if terminated by signal
     } else if (WIFSIGNALED(lastForegroundStatus)) {
         // If so, print appropriate signal number
-        printf("Terminating signal: %d\n", WTERMSIG(lastForegroundStatus));
+        outStr(&shellOut, "Terminating signal: ");
+        outInt(&shellOut, WTERMSIG(lastForegroundStatus));
+        outStr(&shellOut, "\n");
     // If neither, then the process got terminated in some other way (?)
     } else {
-        printf("Unknown termination status\n");
+        outStr(&shellOut, "Unknown termination status\n");
     }
     // Flush output
-    fflush(stdout);
+    outWrite(&shellOut);
 }
 
 
 /* ----------------------------------------
-    Function: execOther
+    Function: execExport
 ===========================================
-Desc: Uses the execvp function to execute
-all commands that are not "cd", "exit", or
-"status".
+Desc: Sets and exports variables given as
+NAME=VALUE, or exports existing ones given as
+NAME (an unset NAME is an error). Names must be
+[A-Za-z_][A-Za-z0-9_]*. With no arguments, lists
+the exported variables.
 
 Params:
-command: Command * , command to be executed
+command: Command *
 ---------------------------------------- */
-void execOther(Command * command){
+void execExport(Command * command){
+    if(command->argCount < 2) {
+        char ** envp = varEnvp();
+        for(int i = 0; envp != NULL && envp[i] != NULL; i++) {
+            outStr(&shellOut, "export ");
+            outStr(&shellOut, envp[i]);
+            outStr(&shellOut, "\n");
+        }
+        return;
+    }
+    for(int i = 1; i < command->argCount; i++) {
+        char * arg = command->command[i];
+        char * equals = strchr(arg, '=');
+        size_t nameLen = (equals != NULL) ? (size_t)(equals - arg) : strlen(arg);
+        // Same names expandToken can expand
+        if(nameLen == 0 || varNameLen(arg) != nameLen) {
+            fprintf(stderr, "export: '%s': not a valid identifier\n", arg);
+            continue;
+        }
+        // Bare NAME exports the current value
+        const char * value = (equals != NULL) ? equals + 1 : varLookup(arg, nameLen);
+        if(value == NULL) {
+            fprintf(stderr, "export: '%s': not set, use export %s=VALUE\n", arg, arg);
+            continue;
+        }
+        if(varSet(arg, nameLen, value, 1) == -1) {
+            fprintf(stderr, "Memory budget exceeded, export of '%s' skipped.\n", arg);
+        }
+    }
+}
 
-    // Command is executed
-    execvp(command->command[0], command->command);
-    // If done correctly this will never be executed
-    perror("execvp");
-    exit(1);
+/* ----------------------------------------
+    Function: execUnset
+===========================================
+Desc: Removes each named variable from the
+shell and from the environment of children.
+
+Params:
+command: Command *
+---------------------------------------- */
+void execUnset(Command * command){
+    for(int i = 1; i < command->argCount; i++) {
+        varUnset(command->command[i], strlen(command->command[i]));
+    }
+}
+
+
+/* ----------------------------------------
+    Function: mapNextItem
+===========================================
+Desc: Gets map's next argument, either from the
+rest of the command line or, one whitespace
+separated word at a time, from the list file.
+Reading the list lazily lets batches start
+before the whole list has arrived.
+
+Params:
+command: Command * , the map command line
+index: int * , next command line item
+list: FILE * , list file, NULL to use the line
+word: char * , MAX_CHARS buffer for the item
+jobs: MapJobs * , batches to reap while the list
+is waited on, NULL to just block in getc
+Returns: length of the item, 0 when there are no more
+---------------------------------------- */
+size_t mapNextItem(Command * command, int * index, FILE * list, char * word, MapJobs * jobs){
+    if(list == NULL) {
+        if(*index >= command->argCount) {
+            return 0;
+        }
+        strncpy(word, command->command[(*index)++], MAX_CHARS - 1);
+        word[MAX_CHARS - 1] = '\0';
+        return strlen(word);
+    }
+
+    size_t len = 0;
+    int c;
+    // Skip separators, then read up to the next one
+    do {
+        // Ctrl-C while waiting on the list drops the partial word and ends the items
+        if(jobs != NULL && mapWaitList(list, jobs) == -1) {
+            word[0] = '\0';
+            return 0;
+        }
+        c = getc(list);
+    } while(c != EOF && (c == ' ' || c == '\t' || c == '\n'));
+    while(c != EOF && c != ' ' && c != '\t' && c != '\n') {
+        if(len < MAX_CHARS - 1) {
+            word[len++] = c;
+        }
+        if(jobs != NULL && mapWaitList(list, jobs) == -1) {
+            word[0] = '\0';
+            return 0;
+        }
+        c = getc(list);
+    }
+    word[len] = '\0';
+    return len;
+}
+
+/* ----------------------------------------
+    Function: mapWaitList
+===========================================
+Desc: Returns once the list has input (or EOF)
+to read, reaping batches that finish meanwhile
+so their times are not stretched by a slow list.
+SIGINT cuts the wait short: it is only let in
+during ppoll, which it interrupts whether or not
+SA_RESTART is set, so it can't slip in between
+the check and the sleep.
+
+Params:
+list: FILE * , list file
+jobs: MapJobs * , running batches
+Returns: 0 when the list can be read, -1 on SIGINT
+---------------------------------------- */
+int mapWaitList(FILE * list, MapJobs * jobs){
+    // Input stdio already holds, or a seen EOF, needs no wait
+    // (glibc's FILE fields, as gnulib's freadahead reads them)
+    if(feof(list) || list->_IO_read_ptr < list->_IO_read_end) {
+        return sigintReceived ? -1 : 0;
+    }
+    sigset_t intMask, waitMask;
+    sigemptyset(&intMask);
+    sigaddset(&intMask, SIGINT);
+    sigprocmask(SIG_BLOCK, &intMask, &waitMask);
+    int ready = 0;
+    while(!ready && !sigintReceived) {
+        mapReap(jobs, WNOHANG);
+        if(sigintReceived) {
+            break;
+        }
+        // Sleep until the list is readable, a child exits or SIGINT arrives
+        struct pollfd fds[2];
+        fds[0].fd = fileno(list);
+        fds[0].events = POLLIN;
+        fds[1].fd = jobs->childFd;      // poll skips it when -1
+        fds[1].events = POLLIN;
+        if(ppoll(fds, 2, NULL, &waitMask) == -1) {
+            // EINTR: the loop checks sigintReceived, anything else let getc report
+            ready = (errno != EINTR);
+            continue;
+        }
+        ready = (fds[0].revents != 0);
+        // Drain the SIGCHLD notifications, the loop reaps what they were for
+        struct signalfd_siginfo info;
+        while(jobs->childFd != -1 && read(jobs->childFd, &info, sizeof(info)) > 0) {
+        }
+    }
+    sigprocmask(SIG_SETMASK, &waitMask, NULL);
+    return sigintReceived ? -1 : 0;
+}
+
+/* ----------------------------------------
+    Function: outSeconds
+===========================================
+Desc: Appends the time between start and end
+as seconds with millisecond precision.
+
+Params:
+out: OutBuf * , buffer to append to
+start: struct timespec , start time
+end: struct timespec , end time
+---------------------------------------- */
+void outSeconds(OutBuf * out, struct timespec start, struct timespec end){
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    outInt(out, ms / 1000);
+    outStr(out, (ms % 1000 < 10) ? ".00" : (ms % 1000 < 100) ? ".0" : ".");
+    outInt(out, ms % 1000);
+    outStr(out, "s");
 }
 
+/* ----------------------------------------
+    Function: mapReap
+===========================================
+Desc: Waits for one of map's batches to finish,
+or with WNOHANG reaps every batch that already
+has, and reports their timing. Background jobs
+reaped along the way are reported as usual.
+
+Params:
+jobs: MapJobs * , running batches
+options: int , 0 or WNOHANG, as for waitpid
+---------------------------------------- */
+void mapReap(MapJobs * jobs, int options){
+    MapSlot * slots = jobs->slots;
+    while(jobs->running > 0 || options == WNOHANG) {
+        int childStatus;
+        pid_t childPid = waitpid(-1, &childStatus, options);
+        if(childPid == 0) {
+            return;
+        }
+        if(childPid == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            jobs->running = 0;
+            return;
+        }
+
+        int slot = 0;
+        while(slot < jobs->running && slots[slot].pid != childPid) {
+            slot++;
+        }
+        // Not ours, a background job finished
+        if(slot == jobs->running) {
+            backgroundJobs--;
+            outChildStatus(&shellOut, childPid, childStatus);
+            outWrite(&shellOut);
+            continue;
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        outStr(&shellOut, "map: batch ");
+        outInt(&shellOut, slots[slot].batch);
+        outStr(&shellOut, " (pid ");
+        outInt(&shellOut, childPid);
+        outStr(&shellOut, ", ");
+        outInt(&shellOut, slots[slot].argCount);
+        outStr(&shellOut, " args): ");
+        if(WIFSIGNALED(childStatus)) {
+            outStr(&shellOut, "terminated by signal ");
+            outInt(&shellOut, WTERMSIG(childStatus));
+        } else {
+            outStr(&shellOut, "exit ");
+            outInt(&shellOut, WEXITSTATUS(childStatus));
+        }
+        outStr(&shellOut, ", ");
+        outSeconds(&shellOut, slots[slot].start, end);
+        outStr(&shellOut, "\n");
+        outWrite(&shellOut);
+
+        if(!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0) {
+            jobs->failedStatus = childStatus;
+        }
+        // A batch killed by SIGINT cancels the rest of the map, like Ctrl-C would
+        if(WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT) {
+            sigintReceived = 1;
+        }
+        slots[slot] = slots[--jobs->running];
+        if(options != WNOHANG) {
+            return;
+        }
+    }
+}
+
+/* ----------------------------------------
+    Function: mapLaunch
+===========================================
+Desc: Starts one of map's batches, first waiting
+for a running one to finish if all N slots are busy.
+Batches that finished by then are reaped right
+after, so their times are not held up.
+
+Params:
+batch: Command * , template args plus items
+number: int , batch number for the report
+templateArgs: int , leading args that are not items
+jobs: MapJobs * , running batches
+parallel: int , number of slots
+Returns: 0, -1 if cancelled while waiting for a slot
+---------------------------------------- */
+int mapLaunch(Command * batch, int number, int templateArgs, MapJobs * jobs, int parallel){
+    // Wait for a free slot
+    if(jobs->running == parallel) {
+        mapReap(jobs, 0);
+    }
+    if(sigintReceived) {
+        return -1;
+    }
+    MapSlot * slot = &jobs->slots[jobs->running];
+    slot->pid = launchCommand(batch, &shellMask);
+    slot->batch = number;
+    slot->argCount = batch->argCount - templateArgs;
+    clock_gettime(CLOCK_MONOTONIC, &slot->start);
+    jobs->running++;
+    mapReap(jobs, WNOHANG);
+    return 0;
+}
+
+/* ----------------------------------------
+    Function: execMap
+===========================================
+Desc: map [-P N] [-n K] cmd [args] -- items
+      map [-P N] [-n K] cmd [args] -- < listfile
+Runs cmd with up to K items appended per run
+(default: as many as fit in ARG_MAX), with up
+to N runs at once (default 1), like xargs -P.
+SIGINT (or a batch killed by it) stops new
+launches, the running batches are waited for.
+A listfile of '-' streams items from the shell's
+input until end-of-file. Each batch is launched
+as soon as it fills, through launchCommand, with
+stdin at EOF and items passed literally; '<', '>'
+in the command or on the line and '&' are refused.
+Every batch's time is reported, so
+K and N can be tuned, and $? is the status of a
+failed batch or 0.
+
+Params:
+command: Command * , the map command line
+---------------------------------------- */
+void execMap(Command * command){
+    int parallel = 1;
+    int perBatch = MAX_ARGS;
+    int i = 1;
+
+    // Options
+    while(i + 1 < command->argCount
+          && (strcmp(command->command[i], "-P") == 0 || strcmp(command->command[i], "-n") == 0)) {
+        int value = atoi(command->command[i + 1]);
+        if(value < 1) {
+            fprintf(stderr, "map: %s needs a positive number\n", command->command[i]);
+            return;
+        }
+        if(command->command[i][1] == 'P') {
+            parallel = (value > MAP_MAX_PARALLEL) ? MAP_MAX_PARALLEL : value;
+        } else {
+            perBatch = value;
+        }
+        i += 2;
+    }
+
+    // Command to run is everything up to '--'
+    int templateStart = i;
+    int templateEnd = i;
+    while(templateEnd < command->argCount && strcmp(command->command[templateEnd], "--") != 0) {
+        templateEnd++;
+    }
+    if(templateEnd == templateStart || templateEnd == command->argCount) {
+        fprintf(stderr, "Usage: map [-P N] [-n K] cmd [args] -- <items...|< listfile>\n");
+        return;
+    }
+    int templateArgs = templateEnd - templateStart;
+
+    // Each batch would redo a redirection (and truncate '>' output), so refuse them
+    if(command->background) {
+        fprintf(stderr, "map: cannot run in the background\n");
+        return;
+    }
+    if(command->hereDoc != NULL) {
+        fprintf(stderr, "map: here-strings and heredocs are not supported\n");
+        return;
+    }
+    for(int t = templateStart; t < templateEnd; t++) {
+        if(strcmp(command->command[t], "<") == 0 || strcmp(command->command[t], ">") == 0) {
+            fprintf(stderr, "map: redirection in the command is not supported\n");
+            return;
+        }
+    }
+
+    // Items come from the line, or are streamed from a list file
+    int itemIndex = templateEnd + 1;
+    FILE * list = NULL;
+    if(itemIndex < command->argCount && strcmp(command->command[itemIndex], "<") == 0) {
+        if(itemIndex + 1 >= command->argCount) {
+            fprintf(stderr, "Syntax error: missing input file name after '<'\n");
+            return;
+        }
+        const char * listName = command->command[itemIndex + 1];
+        if(itemIndex + 2 < command->argCount) {
+            fprintf(stderr, "map: nothing may follow '< listfile'\n");
+            return;
+        }
+        // Close-on-exec ('e'), so batches don't inherit the list's fd
+        list = (strcmp(listName, "-") == 0) ? stdin : fopen(listName, "re");
+        if(list == NULL) {
+            perror("failed to open input file");
+            return;
+        }
+    }
+    for(int t = itemIndex; list == NULL && t < command->argCount; t++) {
+        if(strcmp(command->command[t], "<") == 0 || strcmp(command->command[t], ">") == 0) {
+            fprintf(stderr, "map: redirection among the items is not supported\n");
+            return;
+        }
+    }
+
+    // Stay under ARG_MAX, leaving room for the environment like xargs does
+    long argMax = sysconf(_SC_ARG_MAX);
+    size_t byteLimit = (argMax > 0) ? (size_t)argMax : 128 * 1024;
+    size_t templateBytes = 2048;
+    char ** envp = varEnvp();
+    for(int e = 0; envp != NULL && envp[e] != NULL; e++) {
+        templateBytes += strlen(envp[e]) + 1 + sizeof(char *);
+    }
+    for(int t = templateStart; t < templateEnd; t++) {
+        templateBytes += strlen(command->command[t]) + 1 + sizeof(char *);
+    }
+
+    // Batches are reaped here, not by handleSIGCHLD
+    holdChildSignals();
+    // map is the foreground job until it returns, Ctrl-C cancels it
+    foregroundProcessRunning = 1;
+    sigintReceived = 0;
+
+    MapJobs jobs;
+    jobs.running = 0;
+    jobs.failedStatus = 0;
+    // A list can stall, so while waiting on it the exits of batches are watched too
+    jobs.childFd = -1;
+    if(list != NULL) {
+        sigset_t childMask;
+        sigemptyset(&childMask);
+        sigaddset(&childMask, SIGCHLD);
+        jobs.childFd = signalfd(-1, &childMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+    int batches = 0;
+    int items = 0;
+    Command * batch = NULL;
+    size_t batchBytes = 0;
+    char word[MAX_CHARS];
+    size_t wordLen;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(!sigintReceived) {
+        wordLen = mapNextItem(command, &itemIndex, list, word, &jobs);
+        if(wordLen == 0) {
+            break;
+        }
+
+        // Start a new batch from the command, its stdin an empty heredoc and
+        // its argv literal, so an item named '<' or '>' is just an argument
+        if(batch == NULL) {
+            batch = newCommand(MEM_MAP);
+            if(batch != NULL) {
+                batch->hereDoc = (char *)memAlloc(1, MEM_MAP);
+                batch->literalArgs = 1;
+            }
+            for(int t = templateStart; batch != NULL && batch->hereDoc != NULL && t < templateEnd; t++) {
+                if(addArg(batch, command->command[t], strlen(command->command[t]), MEM_MAP) == -1) {
+                    break;
+                }
+            }
+            if(batch == NULL || batch->hereDoc == NULL || batch->argCount != templateArgs) {
+                fprintf(stderr, "Memory budget exceeded, map stopped.\n");
+                break;
+            }
+            batchBytes = templateBytes;
+        }
+        if(addArg(batch, word, wordLen, MEM_MAP) == -1) {
+            fprintf(stderr, "Memory budget exceeded, map stopped.\n");
+            break;
+        }
+        batchBytes += wordLen + 1 + sizeof(char *);
+
+        // Launch as soon as the batch is full: K items, MAX_ARGS, or no room
+        // left under ARG_MAX for another item of the longest possible length
+        if(batch->argCount - templateArgs >= perBatch || batch->argCount >= MAX_ARGS
+           || batchBytes + MAX_CHARS + sizeof(char *) > byteLimit) {
+            if(mapLaunch(batch, batches + 1, templateArgs, &jobs, parallel) == -1) {
+                break;
+            }
+            batches++;
+            items += batch->argCount - templateArgs;
+            freeCommand(batch);
+            batch = NULL;
+        }
+    }
+
+    // Only the last, partial batch waits for the items to run out
+    if(batch != NULL && batch->argCount > templateArgs && !sigintReceived
+       && mapLaunch(batch, batches + 1, templateArgs, &jobs, parallel) == 0) {
+        batches++;
+        items += batch->argCount - templateArgs;
+    }
+
+    // Let the launched batches finish
+    while(jobs.running > 0) {
+        mapReap(&jobs, 0);
+    }
+    if(jobs.childFd != -1) {
+        close(jobs.childFd);
+    }
+    if(batch != NULL) {
+        freeCommand(batch);
+    }
+    if(list == stdin) {
+        clearerr(stdin);
+    } else if(list != NULL) {
+        fclose(list);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    foregroundProcessRunning = 0;
+
+    outStr(&shellOut, sigintReceived ? "map: interrupted after " : "map: ");
+    outInt(&shellOut, batches);
+    outStr(&shellOut, " batches, ");
+    outInt(&shellOut, items);
+    outStr(&shellOut, " args, -P ");
+    outInt(&shellOut, parallel);
+    outStr(&shellOut, ", ");
+    outSeconds(&shellOut, start, end);
+    outStr(&shellOut, "\n");
+    lastForegroundStatus = jobs.failedStatus;
+    // Background jobs that finish from now on are reported once parseCommand releases SIGCHLD
+}
+
+
+/* ----------------------------------------
+    Function: execMeminfo
+===========================================
+Desc: Prints current use and high-water mark
+of each memory subsystem, the budget (if any),
+and the shell's measured resident set size.
+Runs in the shell itself, no fork.
+
+Params: N/A
+---------------------------------------- */
+void execMeminfo(){
+    outStr(&shellOut, "subsystem\tin use\thigh water\tfailures\n");
+    for(int i = 0; i < MEM_SUBSYSTEMS; i++) {
+        outStr(&shellOut, memNames[i]);
+        outStr(&shellOut, "\t");
+        outInt(&shellOut, memStats[i].inUse);
+        outStr(&shellOut, "\t");
+        outInt(&shellOut, memStats[i].highWater);
+        outStr(&shellOut, "\t");
+        outInt(&shellOut, memStats[i].failures);
+        outStr(&shellOut, "\n");
+    }
+    outStr(&shellOut, "total\t");
+    outInt(&shellOut, memTotal.inUse);
+    outStr(&shellOut, "\t");
+    outInt(&shellOut, memTotal.highWater);
+    outStr(&shellOut, "\t");
+    outInt(&shellOut, memTotal.failures);
+    outStr(&shellOut, "\nbudget\t");
+    if(memBudget == 0) {
+        outStr(&shellOut, "unlimited\n");
+    } else {
+        outInt(&shellOut, memBudget);
+        outStr(&shellOut, "\n");
+    }
+
+    // Measured footprint
+    char status[4096];
+    int fd = open("/proc/self/status", O_RDONLY);
+    if(fd != -1) {
+        ssize_t n = read(fd, status, sizeof(status) - 1);
+        close(fd);
+        status[(n > 0) ? n : 0] = '\0';
+        for(char * line = strtok(status, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            if(strncmp(line, "VmRSS:", 6) == 0 || strncmp(line, "VmHWM:", 6) == 0) {
+                outStr(&shellOut, line);
+                outStr(&shellOut, "\n");
+            }
+        }
+    }
+    // Table goes out with the next prompt
+}
+
+
+/* ----------------------------------------
+    Function: execOther
+===========================================
+Desc: Uses the execvp function to execute
+all commands that are not "cd", "exit", or
+"status".
+
+Params:
+command: Command * , command to be executed
+---------------------------------------- */
+void execOther(Command * command){
+
+    // Child environment (and PATH for execvp) comes from the variable table
+    char ** envp = varEnvp();
+    if(envp != NULL) {
+        environ = envp;
+    }
+    // Command is executed
+    execvp(command->command[0], command->command);
+    // If done correctly this will never be executed
+    perror("execvp");
+    _exit(1);
+}
+
+
+/* ----------------------------------------
+    Function: outStr
+===========================================
+Desc: Appends a string to an output buffer
+without stdio. Async-signal-safe when the buffer
+is local to the caller, so signal handlers use it
+with their own OutBuf. Writes out early only if
+the buffer fills up.
+
+Params:
+out: OutBuf * , buffer to append to
+str: const char * , string to append
+---------------------------------------- */
+void outStr(OutBuf * out, const char * str){
+    size_t len = strlen(str);
+    while(len > 0) {
+        if(out->len == OUT_BUF_SIZE) {
+            outWrite(out);
+        }
+        size_t room = OUT_BUF_SIZE - out->len;
+        size_t n = (len < room) ? len : room;
+        memcpy(out->data + out->len, str, n);
+        out->len += n;
+        str += n;
+        len -= n;
+    }
+}
+
+/* ----------------------------------------
+    Function: outInt
+===========================================
+Desc: Appends a decimal integer to an output
+buffer, async-signal-safe replacement for "%d".
+
+Params:
+out: OutBuf * , buffer to append to
+value: long , number to append
+---------------------------------------- */
+void outInt(OutBuf * out, long value){
+    // Enough for any 64-bit value, sign and terminator
+    char digits[24];
+    int pos = sizeof(digits) - 1;
+    unsigned long magnitude = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+    digits[pos] = '\0';
+    do {
+        digits[--pos] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while(magnitude > 0);
+    if(value < 0) {
+        digits[--pos] = '-';
+    }
+    outStr(out, digits + pos);
+}
+
+/* ----------------------------------------
+    Function: outWrite
+===========================================
+Desc: Emits everything buffered with a single
+write() to stdout (looping only on a partial
+write), then empties the buffer.
+
+Params:
+out: OutBuf * , buffer to write out
+---------------------------------------- */
+void outWrite(OutBuf * out){
+    size_t written = 0;
+    while(written < out->len) {
+        ssize_t n = write(STDOUT_FILENO, out->data + written, out->len - written);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += n;
+    }
+    out->len = 0;
+}
+
+/* ----------------------------------------
+    Function: parseSize
+===========================================
+Desc: Parses a byte count with an optional
+K or M suffix, e.g. "256K".
+
+Params:
+str: const char * , size to parse
+Returns: size in bytes, 0 if invalid
+---------------------------------------- */
+size_t parseSize(const char * str){
+    char * end;
+    unsigned long long size = strtoull(str, &end, 10);
+    if(end == str) {
+        return 0;
+    }
+    if(*end == 'K' || *end == 'k') {
+        size *= 1024;
+        end++;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    return (*end == '\0') ? (size_t)size : 0;
+}
+
+/* ----------------------------------------
+    Function: memInit
+===========================================
+Desc: Sets up the fixed memory region all later
+memAlloc calls are served from. The pages are
+populated up front, so the shell's footprint is
+settled at startup instead of growing later.
+
+Params:
+budget: size_t , region size in bytes
+Returns: 0 on success, -1 on failure
+---------------------------------------- */
+int memInit(size_t budget){
+    budget -= budget % MEM_ALIGN;
+    if(budget < MEM_MIN_BUDGET) {
+        return -1;
+    }
+    void * region = mmap(NULL, budget, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(region == MAP_FAILED) {
+        return -1;
+    }
+    memRegion = region;
+    memBudget = budget;
+
+    // Whole region starts as one free block
+    MemBlock * block = (MemBlock *)memRegion;
+    block->size = memBudget;
+    block->subsystem = MEM_FREE;
+    return 0;
+}
+
+/* ----------------------------------------
+    Function: memAlloc
+===========================================
+Desc: Allocates size bytes charged to a
+subsystem. With a budget the block comes from
+memRegion (first fit, free neighbours merged as
+they are passed), otherwise from malloc. Both
+ways the usage is tracked for meminfo.
+
+Params:
+size: size_t , bytes needed
+subsystem: int , MemSubsystem to charge
+Returns: pointer, NULL if the budget is exhausted
+---------------------------------------- */
+void * memAlloc(size_t size, int subsystem){
+    size_t header = (sizeof(MemBlock) + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    size_t need = (header + size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    MemBlock * found = NULL;
+
+    if(memBudget == 0) {
+        found = (MemBlock *)malloc(need);
+        if(found != NULL) {
+            found->size = need;
+        }
+    } else {
+        char * end = memRegion + memBudget;
+        for(char * pos = memRegion; pos < end; pos += ((MemBlock *)pos)->size) {
+            MemBlock * block = (MemBlock *)pos;
+            if(block->subsystem != MEM_FREE) {
+                continue;
+            }
+            // Merge any free blocks that follow
+            while(pos + block->size < end && ((MemBlock *)(pos + block->size))->subsystem == MEM_FREE) {
+                block->size += ((MemBlock *)(pos + block->size))->size;
+            }
+            if(block->size < need) {
+                continue;
+            }
+            // Split off the remainder if it can hold another block
+            if(block->size - need >= header + MEM_ALIGN) {
+                MemBlock * rest = (MemBlock *)(pos + need);
+                rest->size = block->size - need;
+                rest->subsystem = MEM_FREE;
+                block->size = need;
+            }
+            found = block;
+            break;
+        }
+    }
+
+    if(found == NULL) {
+        memStats[subsystem].failures++;
+        memTotal.failures++;
+        return NULL;
+    }
+    found->subsystem = subsystem;
+
+    // Account for it
+    memStats[subsystem].inUse += found->size;
+    if(memStats[subsystem].inUse > memStats[subsystem].highWater) {
+        memStats[subsystem].highWater = memStats[subsystem].inUse;
+    }
+    memTotal.inUse += found->size;
+    if(memTotal.inUse > memTotal.highWater) {
+        memTotal.highWater = memTotal.inUse;
+    }
+    return (char *)found + header;
+}
+
+/* ----------------------------------------
+    Function: memRealloc
+===========================================
+Desc: Grows a memAlloc block, like realloc. On
+failure the old block is left untouched.
+
+Params:
+ptr: void * , block to grow (NULL allocates)
+size: size_t , bytes needed
+subsystem: int , MemSubsystem to charge
+Returns: pointer, NULL if the budget is exhausted
+---------------------------------------- */
+void * memRealloc(void * ptr, size_t size, int subsystem){
+    size_t header = (sizeof(MemBlock) + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    if(ptr == NULL) {
+        return memAlloc(size, subsystem);
+    }
+    size_t oldSize = ((MemBlock *)((char *)ptr - header))->size - header;
+    if(oldSize >= size) {
+        return ptr;
+    }
+    void * grown = memAlloc(size, subsystem);
+    if(grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, ptr, oldSize);
+    memFree(ptr);
+    return grown;
+}
+
+/* ----------------------------------------
+    Function: memFree
+===========================================
+Desc: Releases a memAlloc block and its charge.
+
+Params:
+ptr: void * , block to free, NULL is ignored
+---------------------------------------- */
+void memFree(void * ptr){
+    size_t header = (sizeof(MemBlock) + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    if(ptr == NULL) {
+        return;
+    }
+    MemBlock * block = (MemBlock *)((char *)ptr - header);
+    memStats[block->subsystem].inUse -= block->size;
+    memTotal.inUse -= block->size;
+
+    if(memBudget == 0) {
+        free(block);
+    } else {
+        block->subsystem = MEM_FREE;
+    }
+}
+
+/* ----------------------------------------
+    Function: varHash
+===========================================
+Desc: FNV-1a hash of a variable name.
+
+Params:
+name: const char * , name (not terminated)
+len: size_t , length of name
+---------------------------------------- */
+unsigned int varHash(const char * name, size_t len){
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* ----------------------------------------
+    Function: varFind
+===========================================
+Desc: Finds a variable in the table, comparing
+hashes before names.
+
+Params:
+name: const char * , name (not terminated)
+len: size_t , length of name
+Returns: the Var, NULL if not set
+---------------------------------------- */
+Var * varFind(const char * name, size_t len){
+    unsigned int hash = varHash(name, len);
+    for(Var * var = varTable[hash % VAR_BUCKETS]; var != NULL; var = var->next) {
+        if(var->hash == hash && var->nameLen == len && memcmp(var->entry, name, len) == 0) {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/* ----------------------------------------
+    Function: varInit
+===========================================
+Desc: Copies the inherited environment into
+the variable table, all marked exported.
+
+Params: N/A
+---------------------------------------- */
+void varInit(){
+    for(char ** env = environ; *env != NULL; env++) {
+        char * equals = strchr(*env, '=');
+        if(equals != NULL && varSet(*env, equals - *env, equals + 1, 1) == -1) {
+            fprintf(stderr, "Memory budget exceeded, environment truncated.\n");
+            return;
+        }
+    }
+}
+
+/* ----------------------------------------
+    Function: varLookup
+===========================================
+Desc: Looks up a shell variable's value.
+
+Params:
+name: const char * , name (not terminated)
+len: size_t , length of name
+Returns: value, NULL if not set
+---------------------------------------- */
+const char * varLookup(const char * name, size_t len){
+    Var * var = varFind(name, len);
+    return (var != NULL) ? var->entry + var->nameLen + 1 : NULL;
+}
+
+/* ----------------------------------------
+    Function: varSet
+===========================================
+Desc: Sets a variable, creating it if needed.
+A variable stays exported once it has been.
+Marks the cached envp stale when an exported
+variable changes.
+
+Params:
+name: const char * , name (not terminated)
+len: size_t , length of name
+value: const char * , new value
+exported: short int , 1 to export it
+Returns: 0 on success, -1 if over the memory budget
+---------------------------------------- */
+int varSet(const char * name, size_t len, const char * value, short int exported){
+    size_t valueLen = strlen(value);
+    char * entry = (char *)memAlloc(len + valueLen + 2, MEM_VARS);
+    if(entry == NULL) {
+        return -1;
+    }
+    memcpy(entry, name, len);
+    entry[len] = '=';
+    memcpy(entry + len + 1, value, valueLen + 1);
+
+    Var * var = varFind(name, len);
+    if(var == NULL) {
+        var = (Var *)memAlloc(sizeof(Var), MEM_VARS);
+        if(var == NULL) {
+            memFree(entry);
+            return -1;
+        }
+        var->hash = varHash(name, len);
+        var->nameLen = len;
+        var->exported = 0;
+        var->entry = NULL;
+        var->next = varTable[var->hash % VAR_BUCKETS];
+        varTable[var->hash % VAR_BUCKETS] = var;
+    }
+    memFree(var->entry);
+    var->entry = entry;
+
+    if(exported && !var->exported) {
+        var->exported = 1;
+        varExportedCount++;
+    }
+    if(var->exported) {
+        varEnvDirty = 1;
+    }
+    return 0;
+}
+
+/* ----------------------------------------
+    Function: varUnset
+===========================================
+Desc: Removes a variable from the table.
+
+Params:
+name: const char * , name (not terminated)
+len: size_t , length of name
+---------------------------------------- */
+void varUnset(const char * name, size_t len){
+    Var ** link = &varTable[varHash(name, len) % VAR_BUCKETS];
+    Var * var = varFind(name, len);
+    if(var == NULL) {
+        return;
+    }
+    while(*link != var) {
+        link = &(*link)->next;
+    }
+    *link = var->next;
+
+    if(var->exported) {
+        varExportedCount--;
+        varEnvDirty = 1;
+    }
+    memFree(var->entry);
+    memFree(var);
+}
+
+/* ----------------------------------------
+    Function: varEnvp
+===========================================
+Desc: Returns the envp array for children,
+pointing at the exported variables' entries.
+It's cached and only rebuilt after an exported
+variable changes.
+
+Params: N/A
+Returns: envp, NULL if it could not be built
+---------------------------------------- */
+char ** varEnvp(){
+    if(!varEnvDirty) {
+        return varEnv;
+    }
+    char ** envp = (char **)memAlloc((varExportedCount + 1) * sizeof(char *), MEM_VARS);
+    if(envp == NULL) {
+        return NULL;
+    }
+    int count = 0;
+    for(int i = 0; i < VAR_BUCKETS; i++) {
+        for(Var * var = varTable[i]; var != NULL; var = var->next) {
+            if(var->exported) {
+                envp[count++] = var->entry;
+            }
+        }
+    }
+    envp[count] = NULL;
+
+    memFree(varEnv);
+    varEnv = envp;
+    varEnvDirty = 0;
+    return varEnv;
+}
+
+/* ----------------------------------------
+    Function: varNameLen
+===========================================
+Desc: Measures the variable name at the start
+of str, [A-Za-z_][A-Za-z0-9_]*.
+
+Params:
+str: const char * , text to scan
+Returns: length of the name, 0 if none
+---------------------------------------- */
+size_t varNameLen(const char * str){
+    size_t len = 0;
+    while(str[len] == '_' || (str[len] >= 'A' && str[len] <= 'Z') || (str[len] >= 'a' && str[len] <= 'z')
+          || (len > 0 && str[len] >= '0' && str[len] <= '9')) {
+        len++;
+    }
+    return len;
+}
+
+/* ----------------------------------------
+    Function: expandToken
+===========================================
+Desc: Copies token into out, expanding $$ (shell
+pid), $? (last foreground status), $NAME and
+${NAME}. Unset variables expand to nothing, a
+'$' not followed by a name is kept as is. Output
+is truncated to fit outSize.
+
+Params:
+token: const char * , word to expand
+out: char * , destination buffer
+outSize: size_t , size of out
+Returns: length of the expanded word
+---------------------------------------- */
+size_t expandToken(const char * token, char * out, size_t outSize){
+    size_t len = 0;
+    char number[24];
+
+    while(*token != '\0' && len < outSize - 1) {
+        const char * value = NULL;
+        const char * name = token + 1;
+        size_t nameLen = 0;
+
+        if(*token != '$') {
+            out[len++] = *token++;
+            continue;
+        }
+
+        if(*name == '$') {
+            snprintf(number, sizeof(number), "%d", (int)getpid());
+            value = number;
+            token += 2;
+        } else if(*name == '?') {
+            int status = WIFSIGNALED(lastForegroundStatus) ? 128 + WTERMSIG(lastForegroundStatus)
+                                                           : WEXITSTATUS(lastForegroundStatus);
+            snprintf(number, sizeof(number), "%d", status);
+            value = number;
+            token += 2;
+        } else if(*name == '{' && strchr(name, '}') != NULL) {
+            name++;
+            nameLen = strchr(name, '}') - name;
+            value = varLookup(name, nameLen);
+            token = name + nameLen + 1;
+        } else if((nameLen = varNameLen(name)) > 0) {
+            value = varLookup(name, nameLen);
+            token = name + nameLen;
+        } else {
+            // Nothing to expand, keep the '$'
+            out[len++] = *token++;
+            continue;
+        }
+
+        // Copy in the value, if set
+        for(; value != NULL && *value != '\0' && len < outSize - 1; value++) {
+            out[len++] = *value;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
 
 /* ----------------------------------------
     Function: freeCommand
@@ -627,10 +2160,12 @@ void freeCommand(Command * command){
             fflush(stdout);
         #endif
         // Free individual command
-        free(command->command[i]);
+        memFree(command->command[i]);
     }
+    // Free here-string / heredoc body
+    memFree(command->hereDoc);
     // Free command struct mem alloc
-    free(command);
+    memFree(command);
 }
 
 /* ----------------------------------------
@@ -8,23 +8,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 
 #define MAX_CHARS 2048
 #define MAX_ARGS 512
+#define OUT_BUF_SIZE 1024
+#define MEM_ALIGN 16
+#define MEM_MIN_BUDGET (16 * 1024)
+#define MEM_FREE -1
+#define VAR_BUCKETS 128
+#define MAP_MAX_PARALLEL 64
 
 typedef struct Command {
-    char command[MAX_ARGS];
+    char * command[MAX_ARGS + 1];
     short int skip;
     short int builtin;
     short int background;
     int argCount;
+    char * hereDoc;             // Body of '<<<' / '<<TAG' input, NULL if none
+    size_t hereDocLen;
+    short int literalArgs;      // Args are passed as is, no '<' / '>' scan (map batches)
 } Command;
 
+// Preallocated buffer for shell-generated output, emitted with one write()
+typedef struct OutBuf {
+    char data[OUT_BUF_SIZE];
+    size_t len;
+} OutBuf;
+
+// Subsystems that shell memory is charged to
+enum MemSubsystem {
+    MEM_PARSER,
+    MEM_HEREDOC,
+    MEM_VARS,
+    MEM_MAP,
+    MEM_SUBSYSTEMS
+};
+
+// Header in front of every memAlloc block
+typedef struct MemBlock {
+    size_t size;                // Bytes including this header
+    int subsystem;              // Owner, MEM_FREE when unused (budget mode)
+} MemBlock;
+
+// Per-subsystem accounting, reported by meminfo
+typedef struct MemStats {
+    size_t inUse;
+    size_t highWater;
+    unsigned long failures;
+} MemStats;
+
+// Shell variable, entry holds "NAME=VALUE" so envp can point straight at it
+typedef struct Var {
+    struct Var * next;          // Next in hash bucket
+    unsigned int hash;
+    size_t nameLen;
+    short int exported;
+    char * entry;
+} Var;
+
+// A running map batch
+typedef struct MapSlot {
+    pid_t pid;
+    int batch;
+    int argCount;
+    struct timespec start;
+} MapSlot;
+
+// A map's running batches, reaped while its list is waited on
+typedef struct MapJobs {
+    MapSlot slots[MAP_MAX_PARALLEL];
+    int running;
+    int failedStatus;           // Status of a failed batch, 0 if none
+    int childFd;                // signalfd for SIGCHLD, -1 if the list isn't watched
+} MapJobs;
+
+extern MemStats memStats[MEM_SUBSYSTEMS];
+
 Command * parseCommand();
+Command * newCommand(int);
+int addArg(Command *, const char *, size_t, int);
 void execCommand(Command *);
 void freeCommand(Command *);
+int readHereDoc(Command *, const char *);
+int setHereString(Command *, const char *);
+int hereDocFd(const char *, size_t);
+void outStr(OutBuf *, const char *);
+void outInt(OutBuf *, long);
+void outWrite(OutBuf *);
+size_t parseSize(const char *);
+int memInit(size_t);
+void * memAlloc(size_t, int);
+void * memRealloc(void *, size_t, int);
+void memFree(void *);
+void execMeminfo();
+const char * varLookup(const char *, size_t);
+int varSet(const char *, size_t, const char *, short int);
+void varUnset(const char *, size_t);
+char ** varEnvp();
+size_t varNameLen(const char *);
+size_t expandToken(const char *, char *, size_t);
+size_t mapNextItem(Command *, int *, FILE *, char *, MapJobs *);
 char * checkExpansion(char *, char *);
 char* replaceToken(char *, char *);
-void test_replaceToken();
 
 #endif /* SMALLSH_H */
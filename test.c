@@ -1,10 +1,14 @@
+#define _GNU_SOURCE             // F_GET_SEALS
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <check.h> // Include the Check header - errors probably will stop when ran on os1
 
 
-// Test using: 
-// gcc -o test_smallsh test.c smallsh.c -lcheck -lm -lpthread -lrt
+// Test using (SMALLSH_TEST leaves out smallsh's main):
+// gcc --std=gnu99 -DSMALLSH_TEST -o test_smallsh test.c smallsh.c -lcheck -lm -lpthread -lrt
 // ./test_smallsh
 
 // Include the header file containing the function to test
@@ -12,16 +16,211 @@
 
 // Define test cases using the START_TEST macro
 START_TEST(test_replaceToken) {
-    char token[] = "TEST$$TEST";
+    char token[64] = "TEST$$TEST";      // Room for the pid to grow into
+    char expected[64];
+    snprintf(expected, sizeof(expected), "TEST%dTEST", (int)getpid());
     char *substring = strstr(token, "$$");
     if (substring != NULL) {
         replaceToken(token, substring);
-        ck_assert_str_eq(token, "TEST1234TEST"); // Assert the expected result
+        ck_assert_str_eq(token, expected); // Assert the expected result
     } else {
         ck_abort_msg("Substring not found");
     }
 } END_TEST
 
+// Reads fd to EOF into buf, returns bytes read
+static size_t readFd(int fd, char *buf, size_t size) {
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf + total, size - total)) > 0) {
+        total += n;
+    }
+    return total;
+}
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+START_TEST(test_hereDocFd_small) {
+    char buf[64];
+    int fd = hereDocFd("hello\n", 6);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(readFd(fd, buf, sizeof(buf)), 6);
+    ck_assert(memcmp(buf, "hello\n", 6) == 0);
+    close(fd);
+} END_TEST
+
+// Compares heredoc fd throughput against writing and reading back a temp file.
+// 512 bytes takes the pipe route, 1 MiB the sealed memfd route.
+START_TEST(test_hereDocFd_throughput) {
+    const size_t sizes[] = { 512, 1 << 20 };
+    const int rounds = 200;
+    char dir[] = "/tmp/smallsh_test_XXXXXX";
+    char tempPath[sizeof(dir) + 16];
+
+    ck_assert_ptr_nonnull(mkdtemp(dir));
+    snprintf(tempPath, sizeof(tempPath), "%s/heredoc", dir);
+
+    for (int s = 0; s < 2; s++) {
+        size_t len = sizes[s];
+        char *body = malloc(len);
+        char *buf = malloc(len + 1);
+        ck_assert_ptr_nonnull(body);
+        ck_assert_ptr_nonnull(buf);
+        for (size_t i = 0; i < len; i++) {
+            body[i] = 'a' + i % 26;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < rounds; i++) {
+            int fd = hereDocFd(body, len);
+            ck_assert_int_ne(fd, -1);
+            // Large bodies must come back sealed against writes
+            if (len > PIPE_BUF) {
+                ck_assert(fcntl(fd, F_GET_SEALS) & F_SEAL_WRITE);
+            }
+            ck_assert_int_eq(readFd(fd, buf, len + 1), len);
+            ck_assert(memcmp(buf, body, len) == 0);
+            close(fd);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double heredocTime = elapsed(start, end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < rounds; i++) {
+            int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            ck_assert_int_ne(fd, -1);
+            ck_assert_int_eq(write(fd, body, len), len);
+            close(fd);
+            fd = open(tempPath, O_RDONLY);
+            ck_assert_int_ne(fd, -1);
+            ck_assert_int_eq(readFd(fd, buf, len + 1), len);
+            ck_assert(memcmp(buf, body, len) == 0);
+            close(fd);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double tempTime = elapsed(start, end);
+        unlink(tempPath);
+
+        printf("heredoc %zu bytes x %d: fd %.3f MB/s, temp file %.3f MB/s\n", len, rounds,
+               len * rounds / heredocTime / 1e6, len * rounds / tempTime / 1e6);
+        free(body);
+        free(buf);
+    }
+    rmdir(dir);
+} END_TEST
+
+START_TEST(test_outInt) {
+    OutBuf out;
+    out.len = 0;
+    outStr(&out, "PID ");
+    outInt(&out, 0);
+    outStr(&out, " ");
+    outInt(&out, 31415);
+    outStr(&out, " ");
+    outInt(&out, -42);
+    ck_assert_int_eq(out.len, strlen("PID 0 31415 -42"));
+    ck_assert(memcmp(out.data, "PID 0 31415 -42", out.len) == 0);
+} END_TEST
+
+START_TEST(test_parseSize) {
+    ck_assert_int_eq(parseSize("4096"), 4096);
+    ck_assert_int_eq(parseSize("256K"), 256 * 1024);
+    ck_assert_int_eq(parseSize("2M"), 2 * 1024 * 1024);
+    ck_assert_int_eq(parseSize("12Q"), 0);
+    ck_assert_int_eq(parseSize(""), 0);
+} END_TEST
+
+START_TEST(test_expandToken) {
+    char out[64];
+    ck_assert_int_eq(varSet("FOO", 3, "bar", 0), 0);
+    ck_assert_int_eq(expandToken("${FOO}x-$FOO-$-$UNSET", out, sizeof(out)), strlen("barx-bar-$-"));
+    ck_assert_str_eq(out, "barx-bar-$-");
+    varUnset("FOO", 3);
+    ck_assert_int_eq(expandToken("$FOO", out, sizeof(out)), 0);
+    // Truncated to the buffer
+    ck_assert_int_eq(expandToken("abcdefgh", out, 4), 3);
+} END_TEST
+
+// export accepts exactly the names expandToken can expand
+START_TEST(test_varNameLen) {
+    ck_assert_int_eq(varNameLen("HOME"), 4);
+    ck_assert_int_eq(varNameLen("_ok9=1"), 4);
+    ck_assert_int_eq(varNameLen("A-B"), 1);
+    ck_assert_int_eq(varNameLen("1A"), 0);
+    ck_assert_int_eq(varNameLen(""), 0);
+} END_TEST
+
+// envp is reused until an exported variable changes
+START_TEST(test_varEnvp_cache) {
+    char **envp = varEnvp();
+    ck_assert_ptr_eq(varEnvp(), envp);
+    ck_assert_int_eq(varSet("LOCAL", 5, "1", 0), 0);
+    ck_assert_ptr_eq(varEnvp(), envp);
+    ck_assert_int_eq(varSet("SHARED", 6, "2", 1), 0);
+    envp = varEnvp();
+    ck_assert_ptr_nonnull(envp);
+    ck_assert_str_eq(envp[0], "SHARED=2");
+    ck_assert_ptr_null(envp[1]);
+} END_TEST
+
+// map items come from the command line, or word by word from a list file
+START_TEST(test_mapNextItem) {
+    char word[MAX_CHARS];
+    int index = 1;
+    Command *command = newCommand(MEM_MAP);
+    ck_assert_ptr_nonnull(command);
+    ck_assert_int_eq(addArg(command, "--", 2, MEM_MAP), 0);
+    ck_assert_int_eq(addArg(command, "a.txt", 5, MEM_MAP), 0);
+    ck_assert_int_eq(mapNextItem(command, &index, NULL, word, NULL), 5);
+    ck_assert_str_eq(word, "a.txt");
+    ck_assert_int_eq(mapNextItem(command, &index, NULL, word, NULL), 0);
+
+    FILE *list = tmpfile();
+    ck_assert_ptr_nonnull(list);
+    fputs("  one two\n\nthree\tfour\n", list);
+    rewind(list);
+    const char *expected[] = { "one", "two", "three", "four" };
+    for (int i = 0; i < 4; i++) {
+        ck_assert_int_eq(mapNextItem(command, &index, list, word, NULL), strlen(expected[i]));
+        ck_assert_str_eq(word, expected[i]);
+    }
+    ck_assert_int_eq(mapNextItem(command, &index, list, word, NULL), 0);
+    fclose(list);
+    freeCommand(command);
+    ck_assert_int_eq(memStats[MEM_MAP].inUse, 0);
+} END_TEST
+
+// Fills a fixed budget, then checks freed space is merged and reused
+START_TEST(test_memAlloc_budget) {
+    void *blocks[64];
+    int count = 0;
+
+    ck_assert_int_eq(memInit(MEM_MIN_BUDGET), 0);
+    while (count < 64 && (blocks[count] = memAlloc(1000, MEM_PARSER)) != NULL) {
+        count++;
+    }
+    ck_assert_int_lt(count, 64);
+    ck_assert_int_eq(memStats[MEM_PARSER].failures, 1);
+    ck_assert_ptr_null(memAlloc(4000, MEM_HEREDOC));
+
+    for (int i = 0; i < count; i++) {
+        memFree(blocks[i]);
+    }
+    ck_assert_int_eq(memStats[MEM_PARSER].inUse, 0);
+    ck_assert(memStats[MEM_PARSER].highWater <= MEM_MIN_BUDGET);
+
+    // Adjacent free blocks merge into room for a larger one
+    void *big = memAlloc(MEM_MIN_BUDGET / 2, MEM_HEREDOC);
+    ck_assert_ptr_nonnull(big);
+    // No room to grow it in place of a second copy, original stays valid
+    ck_assert_ptr_null(memRealloc(big, MEM_MIN_BUDGET / 2 + 100, MEM_HEREDOC));
+    memFree(big);
+    ck_assert_int_eq(memStats[MEM_HEREDOC].inUse, 0);
+} END_TEST
+
 // Create a test suite
 Suite *token_suite(void) {
     Suite *s;
@@ -32,6 +231,15 @@ Suite *token_suite(void) {
 
     // Add the test case to the test suite
     tcase_add_test(tc_core, test_replaceToken);
+    tcase_add_test(tc_core, test_hereDocFd_small);
+    tcase_add_test(tc_core, test_hereDocFd_throughput);
+    tcase_add_test(tc_core, test_outInt);
+    tcase_add_test(tc_core, test_parseSize);
+    tcase_add_test(tc_core, test_expandToken);
+    tcase_add_test(tc_core, test_varNameLen);
+    tcase_add_test(tc_core, test_varEnvp_cache);
+    tcase_add_test(tc_core, test_mapNextItem);
+    tcase_add_test(tc_core, test_memAlloc_budget);
     suite_add_tcase(s, tc_core);
 
     return s;